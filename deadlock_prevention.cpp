@@ -1,14 +1,28 @@
 #include "deadlock_prevention.hpp"
 #include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-double SimpleNeuralNetwork::predict(const std::vector<double>& input) {
+std::pmr::memory_resource* scratch_resource() {
+    thread_local std::pmr::unsynchronized_pool_resource pool;
+    return &pool;
+}
+
+double SimpleNeuralNetwork::predict(const std::vector<double>& input) const {
+    return predict(input.data(), input.size());
+}
+
+double SimpleNeuralNetwork::predict(const double* input, size_t count) const {
     // Forward propagation
-    std::vector<double> hidden(bias1.size());
+    std::pmr::vector<double> hidden(bias1.size(), scratch_resource());
     
     // Hidden layer
     for(size_t i = 0; i < hidden.size(); i++) {
         hidden[i] = bias1[i];
-        for(size_t j = 0; j < input.size(); j++) {
+        for(size_t j = 0; j < count; j++) {
             hidden[i] += input[j] * weights1[j][i];
         }
         hidden[i] = sigmoid(hidden[i]);
@@ -23,65 +37,496 @@ double SimpleNeuralNetwork::predict(const std::vector<double>& input) {
     return sigmoid(output);
 }
 
-void SimpleNeuralNetwork::train(const std::vector<std::vector<double>>& X, const std::vector<double>& y) {
-    std::cout << "Starting neural network training with " << X.size() << " examples\n";
-    // Simple stochastic gradient descent
-    double learning_rate = 0.1;
+void SimpleNeuralNetwork::predict_batch(const double* inputs, size_t rows, double* out) const {
+    size_t input_count = weights1.size();
+    std::pmr::vector<double> hidden(bias1.size(), scratch_resource());
     
-    for(size_t sample = 0; sample < X.size(); sample++) {
-        const auto& input = X[sample];
-        double target = y[sample];
-        
-        // Forward propagation
-        std::vector<double> hidden(bias1.size());
+    for(size_t row = 0; row < rows; row++) {
+        const double* input = inputs + row * input_count;
         
         // Hidden layer
         for(size_t i = 0; i < hidden.size(); i++) {
             hidden[i] = bias1[i];
-            for(size_t j = 0; j < input.size(); j++) {
+        }
+        for(size_t j = 0; j < input_count; j++) {
+            for(size_t i = 0; i < hidden.size(); i++) {
                 hidden[i] += input[j] * weights1[j][i];
             }
-            hidden[i] = sigmoid(hidden[i]);
         }
         
         // Output layer
         double output = bias2[0];
         for(size_t i = 0; i < hidden.size(); i++) {
-            output += hidden[i] * weights2[i][0];
+            output += sigmoid(hidden[i]) * weights2[i][0];
         }
-        output = sigmoid(output);
-        
-        // Backpropagation
-        double output_error = output - target;
-        double output_delta = output_error * output * (1 - output);
-        
-        // Update output layer
-        bias2[0] -= learning_rate * output_delta;
-        for(size_t i = 0; i < hidden.size(); i++) {
-            weights2[i][0] -= learning_rate * output_delta * hidden[i];
+        out[row] = sigmoid(output);
+    }
+}
+
+void SimpleNeuralNetwork::train(const std::vector<std::vector<double>>& X, const std::vector<double>& y) {
+    std::cout << "Starting neural network training with " << X.size() << " examples\n";
+    // Simple stochastic gradient descent
+    double learning_rate = 0.1;
+    std::pmr::vector<double> hidden(bias1.size(), scratch_resource());
+    
+    for(size_t sample = 0; sample < X.size(); sample++) {
+        train_sample(X[sample].data(), y[sample], learning_rate, hidden.data());
+    }
+}
+
+void SimpleNeuralNetwork::train(const double* X, const double* y, size_t rows) {
+    std::cout << "Starting neural network training with " << rows << " examples\n";
+    // Simple stochastic gradient descent
+    double learning_rate = 0.1;
+    std::pmr::vector<double> hidden(bias1.size(), scratch_resource());
+    
+    for(size_t sample = 0; sample < rows; sample++) {
+        train_sample(X + sample * weights1.size(), y[sample], learning_rate, hidden.data());
+    }
+}
+
+void SimpleNeuralNetwork::train_sample(const double* input, double target, double learning_rate, double* hidden) {
+    size_t input_count = weights1.size();
+    size_t hidden_count = bias1.size();
+    
+    // Hidden layer
+    for(size_t i = 0; i < hidden_count; i++) {
+        hidden[i] = bias1[i];
+        for(size_t j = 0; j < input_count; j++) {
+            hidden[i] += input[j] * weights1[j][i];
         }
+        hidden[i] = sigmoid(hidden[i]);
+    }
+    
+    // Output layer
+    double output = bias2[0];
+    for(size_t i = 0; i < hidden_count; i++) {
+        output += hidden[i] * weights2[i][0];
+    }
+    output = sigmoid(output);
+    
+    // Backpropagation
+    double output_error = output - target;
+    double output_delta = output_error * output * (1 - output);
+    
+    // Update output layer
+    bias2[0] -= learning_rate * output_delta;
+    for(size_t i = 0; i < hidden_count; i++) {
+        weights2[i][0] -= learning_rate * output_delta * hidden[i];
+    }
+    
+    // Update hidden layer
+    for(size_t i = 0; i < hidden_count; i++) {
+        double hidden_error = weights2[i][0] * output_delta;
+        double hidden_delta = hidden_error * hidden[i] * (1 - hidden[i]);
         
-        // Update hidden layer
-        for(size_t i = 0; i < hidden.size(); i++) {
-            double hidden_error = weights2[i][0] * output_delta;
-            double hidden_delta = hidden_error * hidden[i] * (1 - hidden[i]);
-            
-            bias1[i] -= learning_rate * hidden_delta;
-            for(size_t j = 0; j < input.size(); j++) {
-                weights1[j][i] -= learning_rate * hidden_delta * input[j];
+        bias1[i] -= learning_rate * hidden_delta;
+        for(size_t j = 0; j < input_count; j++) {
+            weights1[j][i] -= learning_rate * hidden_delta * input[j];
+        }
+    }
+}
+
+namespace {
+
+const uint32_t JOURNAL_MAGIC = 0x4c4e524a;  // "JRNL"
+const uint32_t SNAPSHOT_MAGIC = 0x50414e53; // "SNAP"
+const uint32_t SNAPSHOT_VERSION = 2;
+
+struct JournalHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t generation;
+};
+
+struct RecordHeader {
+    uint32_t type;
+    int32_t process_id;
+    uint32_t count;
+    uint32_t checksum;
+};
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    uint64_t count;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+// FNV-1a over the payload, used to detect torn writes at the journal tail
+uint32_t checksum_ints(const int32_t* data, size_t count) {
+    uint32_t hash = 2166136261u;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < count * sizeof(int32_t); i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool write_all(int fd, const char* data, size_t size) {
+    while(size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if(written < 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Read-only mapping of a whole file, unmapped on scope exit
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return;
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(addr != MAP_FAILED) {
+                data = static_cast<const char*>(addr);
+                size = st.st_size;
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if(data) munmap(const_cast<char*>(data), size);
+    }
+};
+
+} // namespace
+
+AllocationJournal::AllocationJournal(const std::string& path_prefix, size_t group_commit_size,
+                                     size_t snapshot_interval, std::chrono::milliseconds max_commit_delay)
+    : journal_path(path_prefix + ".journal"),
+      snapshot_path(path_prefix + ".snapshot"),
+      group_commit_size(group_commit_size > 0 ? group_commit_size : 1),
+      snapshot_interval(snapshot_interval),
+      max_commit_delay(max_commit_delay)
+{
+    pending.reserve(this->group_commit_size * (sizeof(RecordHeader) + 16 * sizeof(int32_t)));
+}
+
+AllocationJournal::~AllocationJournal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    flush_cv.notify_all();
+    if(flush_thread.joinable()) {
+        flush_thread.join();
+    }
+    commit();
+    if(fd >= 0) ::close(fd);
+}
+
+bool AllocationJournal::recover(const SnapshotHandler& on_snapshot, const RecordHandler& on_record,
+                                bool& found_state) {
+    found_state = false;
+
+    // Load the snapshot, if any
+    {
+        MappedFile snapshot(snapshot_path);
+        if(snapshot.data) {
+            if(snapshot.size < sizeof(SnapshotHeader)) return false;
+            SnapshotHeader header;
+            std::memcpy(&header, snapshot.data, sizeof(header));
+            const int32_t* body = reinterpret_cast<const int32_t*>(snapshot.data + sizeof(header));
+            if(header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+               snapshot.size < sizeof(header) + header.count * sizeof(int32_t) ||
+               checksum_ints(body, header.count) != header.checksum) {
+                return false;
             }
+            if(!on_snapshot(body, header.count)) return false;
+            generation = header.generation;
+            found_state = true;
+        }
+    }
+
+    // Replay records written after the snapshot, stopping at a torn tail
+    size_t valid_size = 0;
+    {
+        MappedFile log(journal_path);
+        if(log.data && log.size >= sizeof(JournalHeader)) {
+            JournalHeader header;
+            std::memcpy(&header, log.data, sizeof(header));
+            // A journal from an older generation was superseded by the snapshot
+            if(header.magic == JOURNAL_MAGIC && header.generation == generation) {
+                size_t offset = sizeof(header);
+                while(offset + sizeof(RecordHeader) <= log.size) {
+                    RecordHeader record;
+                    std::memcpy(&record, log.data + offset, sizeof(record));
+                    size_t end = offset + sizeof(record) + record.count * sizeof(int32_t);
+                    if(end > log.size) break;
+                    const int32_t* payload = reinterpret_cast<const int32_t*>(log.data + offset + sizeof(record));
+                    if(checksum_ints(payload, record.count) != record.checksum) break;
+                    on_record(static_cast<RecordType>(record.type), record.process_id, payload, record.count);
+                    found_state = true;
+                    records_since_snapshot++;
+                    offset = end;
+                }
+                valid_size = offset;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    fd = ::open(journal_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0) return false;
+    if(valid_size == 0) {
+        if(!reset_journal()) return false;
+    } else {
+        // Drop any partial record so new appends follow the last valid one
+        if(ftruncate(fd, valid_size) != 0 || lseek(fd, valid_size, SEEK_SET) < 0) return false;
+        committed_size = valid_size;
+    }
+
+    // Flush buffered records no later than max_commit_delay after they arrive,
+    // so an idle arbiter does not leave acknowledged mutations in memory
+    if(max_commit_delay.count() > 0 && !flush_thread.joinable()) {
+        flush_thread = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while(!stopping) {
+                flush_cv.wait(lock, [this]() { return stopping || snapshot_queued || !pending.empty(); });
+                if(stopping) break;
+                if(snapshot_queued) {
+                    if(!write_queued_snapshot(lock) && !failed) {
+                        std::cerr << "Allocation journal: failed to write snapshot '" << snapshot_path << "'\n";
+                    }
+                    continue;
+                }
+                flush_cv.wait_for(lock, max_commit_delay,
+                                  [this]() { return stopping || snapshot_queued || pending.empty(); });
+                if(snapshot_queued) continue;
+                if(!pending.empty() && !commit_locked() && !failed) {
+                    std::cerr << "Allocation journal: failed to flush '" << journal_path << "'\n";
+                }
+            }
+        });
+    }
+    return true;
+}
+
+bool AllocationJournal::append(RecordType type, int process_id, const int32_t* payload, size_t count) {
+    RecordHeader header{static_cast<uint32_t>(type), process_id,
+                        static_cast<uint32_t>(count), checksum_ints(payload, count)};
+    const char* header_bytes = reinterpret_cast<const char*>(&header);
+    const char* payload_bytes = reinterpret_cast<const char*>(payload);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if(failed) return false;
+    bool was_empty = pending.empty();
+    pending.insert(pending.end(), header_bytes, header_bytes + sizeof(header));
+    pending.insert(pending.end(), payload_bytes, payload_bytes + count * sizeof(int32_t));
+    pending_records++;
+    records_since_snapshot++;
+
+    if(pending_records >= group_commit_size) {
+        return commit_locked();
+    }
+    if(was_empty) {
+        flush_cv.notify_one();
+    }
+    return true;
+}
+
+bool AllocationJournal::commit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    // Buffered records may belong to a snapshot's new generation; finish it first
+    while(true) {
+        flush_cv.wait(lock, [this]() { return !snapshot_writing; });
+        if(!snapshot_queued) break;
+        write_queued_snapshot(lock);
+    }
+    return commit_locked();
+}
+
+bool AllocationJournal::commit_locked() {
+    if(failed) return false;
+    // While a snapshot is pending, records must not reach the old generation
+    // ahead of it; the snapshot writer commits them after the reset
+    if(snapshot_queued || snapshot_writing) return true;
+    return commit_prefix_locked(pending.size(), pending_records);
+}
+
+bool AllocationJournal::commit_prefix_locked(size_t bytes, size_t records) {
+    if(failed) return false;
+    if(bytes == 0) return true;
+    if(fd < 0) {
+        fail_locked();
+        return false;
+    }
+
+    if(!write_all(fd, pending.data(), bytes) || fdatasync(fd) != 0) {
+        // Cut off the partial write so later appends do not land behind garbage
+        // that recovery would stop at; the records stay pending for a retry
+        if(ftruncate(fd, committed_size) != 0 || lseek(fd, committed_size, SEEK_SET) < 0) {
+            fail_locked();
         }
+        return false;
+    }
+
+    committed_size += bytes;
+    pending.erase(pending.begin(), pending.begin() + bytes);
+    pending_records -= records;
+    return true;
+}
+
+bool AllocationJournal::has_failed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+bool AllocationJournal::snapshot_due() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !failed && snapshot_interval > 0 && records_since_snapshot >= snapshot_interval;
+}
+
+bool AllocationJournal::write_snapshot(const std::vector<int32_t>& state) {
+    std::unique_lock<std::mutex> lock(mutex);
+    flush_cv.wait(lock, [this]() { return !snapshot_writing; });
+    queue_snapshot_locked(std::vector<int32_t>(state));
+    return write_queued_snapshot(lock);
+}
+
+bool AllocationJournal::request_snapshot(std::vector<int32_t>&& state) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if(failed) return false;
+    queue_snapshot_locked(std::move(state));
+    if(!flush_thread.joinable()) {
+        flush_cv.wait(lock, [this]() { return !snapshot_writing; });
+        return write_queued_snapshot(lock);
     }
+    flush_cv.notify_all();
+    return true;
+}
+
+void AllocationJournal::queue_snapshot_locked(std::vector<int32_t>&& state) {
+    // The state covers every record buffered so far; a newer capture replaces an older one
+    snapshot_state = std::move(state);
+    snapshot_split = pending.size();
+    snapshot_split_records = pending_records;
+    snapshot_queued = true;
+    records_since_snapshot = 0;
+}
+
+bool AllocationJournal::write_queued_snapshot(std::unique_lock<std::mutex>& lock) {
+    snapshot_queued = false;
+    std::vector<int32_t> state = std::move(snapshot_state);
+    snapshot_state.clear();
+
+    // Records captured by the snapshot go to the old generation first, so a
+    // failed snapshot loses nothing
+    if(!commit_prefix_locked(snapshot_split, snapshot_split_records)) {
+        records_since_snapshot = std::max(records_since_snapshot, snapshot_interval);
+        return false;
+    }
+
+    // The file write does not touch the journal, so appends continue meanwhile
+    snapshot_writing = true;
+    uint64_t next_generation = generation + 1;
+    lock.unlock();
+
+    SnapshotHeader header{SNAPSHOT_MAGIC, SNAPSHOT_VERSION, next_generation,
+                          state.size(), checksum_ints(state.data(), state.size()), 0};
+
+    // Write to a temporary file and rename so a crash never leaves a partial snapshot
+    std::string tmp_path = snapshot_path + ".tmp";
+    int snap_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = snap_fd >= 0 &&
+              write_all(snap_fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+              write_all(snap_fd, reinterpret_cast<const char*>(state.data()), state.size() * sizeof(int32_t)) &&
+              fsync(snap_fd) == 0;
+    if(snap_fd >= 0) ::close(snap_fd);
+    ok = ok && rename(tmp_path.c_str(), snapshot_path.c_str()) == 0;
+
+    lock.lock();
+    snapshot_writing = false;
+    flush_cv.notify_all();
+    if(!ok) {
+        records_since_snapshot = std::max(records_since_snapshot, snapshot_interval);
+        return false;
+    }
+
+    // The snapshot now covers every record committed before it; start a new
+    // generation and commit the records appended since the capture into it
+    generation = next_generation;
+    if(!reset_journal()) {
+        // Appends to the old generation would be ignored on recovery; fail them instead
+        fail_locked();
+        return false;
+    }
+    return commit_locked();
+}
+
+void AllocationJournal::fail_locked() {
+    if(fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    if(failed) return;
+    // Nothing can reach the file any more: drop the buffer instead of letting
+    // it grow, and report once rather than on every flush attempt
+    failed = true;
+    snapshot_queued = false;
+    snapshot_state.clear();
+    std::cerr << "Allocation journal: '" << journal_path << "' is no longer writable; journaling stopped after "
+              << pending_records << " unsaved records\n";
+    pending.clear();
+    pending_records = 0;
+}
+
+bool AllocationJournal::reset_journal() {
+    JournalHeader header{JOURNAL_MAGIC, 0, generation};
+    if(ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) return false;
+    if(!write_all(fd, reinterpret_cast<const char*>(&header), sizeof(header)) || fdatasync(fd) != 0) return false;
+    committed_size = sizeof(header);
+    return true;
 }
 
 MLAugmentedDeadlockPrevention::MLAugmentedDeadlockPrevention(int num_res, int num_proc)
     : num_resources(num_res), 
       num_processes(num_proc),
-      risk_model(num_res * num_proc + num_res, 10) // Input size = resources*processes + available resources, hidden size = 10
+      // Input size = resources*processes + available resources, hidden size = 10
+      risk_models{SimpleNeuralNetwork(num_res * num_proc + num_res, 10),
+                  SimpleNeuralNetwork(num_res * num_proc + num_res, 10)}
 {
+    risk_models[1] = risk_models[0];
+    model_readers[0] = 0;
+    model_readers[1] = 0;
     available.resize(num_resources, 0);
     allocated.resize(num_processes, std::vector<int>(num_resources, 0));
     max_need.resize(num_processes, std::vector<int>(num_resources, 0));
+    outstanding.resize(num_processes, std::vector<int>(num_resources, 0));
+    blocked.resize(num_processes, 0);
+    unblocked_held.resize(num_resources, 0);
+    publish_rag_snapshot();
+}
+
+MLAugmentedDeadlockPrevention::~MLAugmentedDeadlockPrevention() {
+    stop_detection_daemon();
+}
+
+void MLAugmentedDeadlockPrevention::set_available(const std::vector<int>& resources) {
+    available = resources;
+    journal_record(AllocationJournal::RecordType::SET_AVAILABLE, -1, resources);
+}
+
+void MLAugmentedDeadlockPrevention::set_max_need(const std::vector<std::vector<int>>& need) {
+    max_need = need;
+    if(journal) {
+        std::vector<int> flat;
+        for(const auto& row : need) {
+            flat.insert(flat.end(), row.begin(), row.end());
+        }
+        journal_record(AllocationJournal::RecordType::SET_MAX_NEED, -1, flat);
+    }
 }
 
 void MLAugmentedDeadlockPrevention::allocate_resources(int process_id, const std::vector<int>& resources) {
@@ -89,6 +534,12 @@ void MLAugmentedDeadlockPrevention::allocate_resources(int process_id, const std
         available[i] -= resources[i];
         allocated[process_id][i] += resources[i];
     }
+    if(!blocked[process_id]) {
+        for(int i = 0; i < num_resources; i++) {
+            unblocked_held[i] += resources[i];
+        }
+    }
+    journal_record(AllocationJournal::RecordType::ALLOCATE, process_id, resources);
 }
 
 void MLAugmentedDeadlockPrevention::release_resources(int process_id, const std::vector<int>& resources) {
@@ -96,6 +547,101 @@ void MLAugmentedDeadlockPrevention::release_resources(int process_id, const std:
         available[i] += resources[i];
         allocated[process_id][i] -= resources[i];
     }
+    if(!blocked[process_id]) {
+        for(int i = 0; i < num_resources; i++) {
+            unblocked_held[i] -= resources[i];
+        }
+    }
+    journal_record(AllocationJournal::RecordType::RELEASE, process_id, resources);
+}
+
+void MLAugmentedDeadlockPrevention::block_request(int process_id, const std::vector<int>& resources) {
+    if(!blocked[process_id]) {
+        // Its allocation can no longer be counted on to be returned
+        blocked[process_id] = 1;
+        blocked_count++;
+        for(int i = 0; i < num_resources; i++) {
+            unblocked_held[i] -= allocated[process_id][i];
+        }
+    }
+    std::copy(resources.begin(), resources.begin() + num_resources, outstanding[process_id].begin());
+    journal_record(AllocationJournal::RecordType::BLOCK_REQUEST, process_id, resources);
+}
+
+void MLAugmentedDeadlockPrevention::unblock_request(int process_id) {
+    if(!blocked[process_id]) return;
+    blocked[process_id] = 0;
+    blocked_count--;
+    for(int i = 0; i < num_resources; i++) {
+        unblocked_held[i] += allocated[process_id][i];
+        outstanding[process_id][i] = 0;
+    }
+    journal_record(AllocationJournal::RecordType::UNBLOCK_REQUEST, process_id, outstanding[process_id]);
+}
+
+std::vector<int> MLAugmentedDeadlockPrevention::detect_deadlocked_processes() {
+    std::vector<int> deadlocked;
+    detect_deadlocked_processes(deadlocked);
+    return deadlocked;
+}
+
+void MLAugmentedDeadlockPrevention::detect_deadlocked_processes(std::vector<int>& deadlocked) {
+    deadlocked.clear();
+    if(blocked_count == 0) return;
+    
+    // Processes that are not waiting will eventually finish and return what they hold
+    std::pmr::vector<int> work(num_resources, 0, scratch_resource());
+    for(int j = 0; j < num_resources; j++) {
+        work[j] = available[j] + unblocked_held[j];
+    }
+    
+    // Blocked processes holding nothing cannot be part of a deadlock
+    std::pmr::vector<char> finished(num_processes, 1, scratch_resource());
+    int remaining = 0;
+    for(int i = 0; i < num_processes; i++) {
+        if(!blocked[i]) continue;
+        int held = 0;
+        for(int j = 0; j < num_resources; j++) {
+            held |= allocated[i][j];
+        }
+        if(held != 0) {
+            finished[i] = 0;
+            remaining++;
+        }
+    }
+    
+    // Repeatedly grant any outstanding request that fits and reclaim its allocation
+    bool progress = true;
+    while(remaining > 0 && progress) {
+        progress = false;
+        for(int i = 0; i < num_processes; i++) {
+            if(finished[i]) continue;
+            const int* request = outstanding[i].data();
+            const int* held = allocated[i].data();
+            int* w = work.data();
+            
+            // Branch-free compare so the loop vectorizes over resources
+            int exceeds = 0;
+            for(int j = 0; j < num_resources; j++) {
+                exceeds |= request[j] > w[j];
+            }
+            if(exceeds) continue;
+            
+            for(int j = 0; j < num_resources; j++) {
+                w[j] += held[j];
+            }
+            finished[i] = 1;
+            remaining--;
+            progress = true;
+        }
+    }
+    
+    if(remaining > 0) {
+        deadlocked.reserve(remaining);
+        for(int i = 0; i < num_processes; i++) {
+            if(!finished[i]) deadlocked.push_back(i);
+        }
+    }
 }
 
 bool MLAugmentedDeadlockPrevention::ml_augmented_bankers_check(int process_id, const std::vector<int>& requested_resources) {
@@ -110,22 +656,60 @@ bool MLAugmentedDeadlockPrevention::ml_augmented_bankers_check(int process_id, c
 }
 
 void MLAugmentedDeadlockPrevention::update_rag(int process_id, int resource_id) {
-    rag[process_id].insert(resource_id);
+    if(process_id < 0 || resource_id < 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(rag_write_mutex);
+        if(!rag[process_id].insert(resource_id).second) return;
+
+        // Copy the current snapshot, add the edge and publish the new version
+        auto current = std::atomic_load(&rag_snapshot);
+        auto next = std::make_shared<RagSnapshot>(*current);
+        size_t needed = std::max(process_id, resource_id) + 1;
+        if(next->edges.size() < needed) next->edges.resize(needed);
+        auto& targets = next->edges[process_id];
+        targets.insert(std::lower_bound(targets.begin(), targets.end(), resource_id), resource_id);
+        next->version = current->version + 1;
+        std::atomic_store(&rag_snapshot, std::shared_ptr<const RagSnapshot>(std::move(next)));
+    }
+
+    // Journal outside the lock so other graph writers never wait on journal I/O
+    int32_t edge = resource_id;
+    journal_record(AllocationJournal::RecordType::UPDATE_RAG, process_id, &edge, 1);
+}
+
+void MLAugmentedDeadlockPrevention::publish_rag_snapshot() {
+    std::lock_guard<std::mutex> lock(rag_write_mutex);
+    auto current = std::atomic_load(&rag_snapshot);
+    auto next = std::make_shared<RagSnapshot>();
+    next->edges.resize(num_processes);
+    for(const auto& [process_id, resources] : rag) {
+        int highest = resources.empty() ? process_id : std::max(process_id, *resources.rbegin());
+        if(static_cast<int>(next->edges.size()) <= highest) next->edges.resize(highest + 1);
+        next->edges[process_id].assign(resources.begin(), resources.end());
+    }
+    next->version = current ? current->version + 1 : 0;
+    std::atomic_store(&rag_snapshot, std::shared_ptr<const RagSnapshot>(std::move(next)));
 }
 
 std::vector<std::vector<int>> MLAugmentedDeadlockPrevention::detect_cycles() {
+    return find_cycles(*std::atomic_load(&rag_snapshot));
+}
+
+std::vector<std::vector<int>> MLAugmentedDeadlockPrevention::find_cycles(const RagSnapshot& snapshot) const {
     std::vector<std::vector<int>> cycles;
-    std::vector<bool> visited(num_processes, false);
-    std::vector<int> path;
+    std::pmr::vector<bool> visited(snapshot.edges.size(), false, scratch_resource());
+    std::pmr::vector<int> path(scratch_resource());
+    path.reserve(snapshot.edges.size());
     
     // Simple DFS to detect cycles
-    std::function<void(int)> dfs = [&](int node) {
+    auto dfs = [&](auto& self, int node) -> void {
         visited[node] = true;
         path.push_back(node);
         
-        for(int next : rag[node]) {
+        for(int next : snapshot.edges[node]) {
             if(!visited[next]) {
-                dfs(next);
+                self(self, next);
             } else {
                 // Found a cycle
                 std::vector<int> cycle;
@@ -146,13 +730,76 @@ std::vector<std::vector<int>> MLAugmentedDeadlockPrevention::detect_cycles() {
     
     for(int i = 0; i < num_processes; i++) {
         if(!visited[i]) {
-            dfs(i);
+            dfs(dfs, i);
         }
     }
     
     return cycles;
 }
 
+void MLAugmentedDeadlockPrevention::start_detection_daemon(std::chrono::milliseconds interval,
+                                                           DeadlockCallback on_deadlock) {
+    stop_detection_daemon();
+    {
+        std::lock_guard<std::mutex> lock(detection_mutex);
+        detection_running = true;
+    }
+
+    detection_thread = std::thread([this, interval, on_deadlock]() {
+        uint64_t last_version = UINT64_MAX;
+        std::unique_lock<std::mutex> lock(detection_mutex);
+        while(detection_running) {
+            lock.unlock();
+
+            // Only re-run detection when writers have published a new graph
+            auto snapshot = std::atomic_load(&rag_snapshot);
+            if(snapshot->version != last_version) {
+                last_version = snapshot->version;
+                auto start = std::chrono::steady_clock::now();
+                auto cycles = find_cycles(*snapshot);
+                uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+
+                detection_passes++;
+                detection_last_ns = elapsed;
+                detection_total_ns += elapsed;
+                uint64_t max_ns = detection_max_ns.load();
+                while(elapsed > max_ns && !detection_max_ns.compare_exchange_weak(max_ns, elapsed)) {}
+
+                if(!cycles.empty()) {
+                    detection_deadlocks++;
+                    if(on_deadlock) on_deadlock(cycles);
+                }
+            }
+
+            lock.lock();
+            detection_cv.wait_for(lock, interval, [this]() { return !detection_running; });
+        }
+    });
+}
+
+void MLAugmentedDeadlockPrevention::stop_detection_daemon() {
+    {
+        std::lock_guard<std::mutex> lock(detection_mutex);
+        detection_running = false;
+    }
+    detection_cv.notify_all();
+    if(detection_thread.joinable()) {
+        detection_thread.join();
+    }
+}
+
+MLAugmentedDeadlockPrevention::DetectionStats MLAugmentedDeadlockPrevention::get_detection_stats() const {
+    uint64_t passes = detection_passes.load();
+    return {
+        passes,
+        detection_deadlocks.load(),
+        detection_last_ns.load() / 1000.0,
+        detection_max_ns.load() / 1000.0,
+        passes > 0 ? detection_total_ns.load() / 1000.0 / passes : 0.0
+    };
+}
+
 bool MLAugmentedDeadlockPrevention::ml_augmented_wait_die(int requesting_process, int holding_process,
                                                          const std::unordered_map<int, double>& timestamp) {
     // Traditional Wait-Die logic
@@ -168,7 +815,8 @@ bool MLAugmentedDeadlockPrevention::ml_augmented_wait_die(int requesting_process
 
 double MLAugmentedDeadlockPrevention::predict_deadlock_risk(int process_id, const std::vector<int>& requested_resources) {
     // Create feature vector
-    std::vector<double> features;
+    std::pmr::vector<double> features(scratch_resource());
+    features.reserve(feature_size());
     
     // Add current allocation state
     for(const auto& proc_alloc : allocated) {
@@ -179,27 +827,125 @@ double MLAugmentedDeadlockPrevention::predict_deadlock_risk(int process_id, cons
     features.insert(features.end(), available.begin(), available.end());
     
     // Make prediction
-    double prediction = risk_model.predict(features);
+    int slot = acquire_model();
+    double prediction = risk_models[slot].predict(features.data(), features.size());
+    release_model(slot);
     std::cout << "Deadlock risk prediction for process " << process_id << ": " << prediction << std::endl;
     return prediction;
 }
 
+int MLAugmentedDeadlockPrevention::acquire_model() const {
+    // Register as a reader of the active slot, retrying if it was flipped meanwhile
+    while(true) {
+        int slot = active_model.load();
+        model_readers[slot]++;
+        if(active_model.load() == slot) return slot;
+        model_readers[slot]--;
+    }
+}
+
+void MLAugmentedDeadlockPrevention::release_model(int slot) const {
+    model_readers[slot]--;
+}
+
+void MLAugmentedDeadlockPrevention::predict_risk_batch(const double* features, size_t rows, double* out) const {
+    int slot = acquire_model();
+    risk_models[slot].predict_batch(features, rows, out);
+    release_model(slot);
+}
+
+MLAugmentedDeadlockPrevention::ModelHandle MLAugmentedDeadlockPrevention::pin_model() const {
+    int slot = acquire_model();
+    return ModelHandle{slot, model_slot_version[slot]};
+}
+
+void MLAugmentedDeadlockPrevention::unpin_model(const ModelHandle& model) const {
+    release_model(model.slot);
+}
+
+void MLAugmentedDeadlockPrevention::predict_risk_batch(const ModelHandle& model, const double* features,
+                                                       size_t rows, double* out) const {
+    risk_models[model.slot].predict_batch(features, rows, out);
+}
+
+bool MLAugmentedDeadlockPrevention::is_request_safe(int process_id, const std::vector<int>& requested_resources) {
+    return is_safe_state(process_id, requested_resources);
+}
+
+bool MLAugmentedDeadlockPrevention::is_request_safe(int process_id, const std::vector<int>& requested_resources,
+                                                    const std::vector<int>& available_state,
+                                                    const std::vector<std::vector<int>>& allocated_state) const {
+    return is_safe_state(available_state, allocated_state, process_id, requested_resources);
+}
+
 void MLAugmentedDeadlockPrevention::add_training_example(const std::vector<double>& features, bool led_to_deadlock) {
-    history.push_back({features, led_to_deadlock});
+    std::lock_guard<std::mutex> lock(history_mutex);
+    if(history_capacity == 0) return;
+    
+    // Rows have a fixed stride; short feature vectors are zero-padded
+    size_t stride = feature_size();
+    size_t count = std::min(features.size(), stride);
+    double* row;
+    if(history_labels.size() < history_capacity) {
+        history_labels.push_back(led_to_deadlock ? 1.0 : 0.0);
+        history_features.resize(history_labels.size() * stride);
+        row = &history_features[(history_labels.size() - 1) * stride];
+    } else {
+        // Full: overwrite the oldest example
+        history_labels[history_next] = led_to_deadlock ? 1.0 : 0.0;
+        row = &history_features[history_next * stride];
+        history_next = (history_next + 1) % history_capacity;
+    }
+    std::copy(features.begin(), features.begin() + count, row);
+    std::fill(row + count, row + stride, 0.0);
+}
+
+void MLAugmentedDeadlockPrevention::set_history_capacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    size_t stride = feature_size();
+    
+    // Linearize the ring oldest-to-newest so rows keep their age order whether
+    // the ring grows (new rows append after the newest) or shrinks
+    std::rotate(history_labels.begin(), history_labels.begin() + history_next, history_labels.end());
+    std::rotate(history_features.begin(), history_features.begin() + history_next * stride,
+                history_features.end());
+    history_next = 0;
+    
+    // Keep the newest `capacity` examples
+    if(history_labels.size() > capacity) {
+        size_t dropped = history_labels.size() - capacity;
+        history_labels.erase(history_labels.begin(), history_labels.begin() + dropped);
+        history_features.erase(history_features.begin(), history_features.begin() + dropped * stride);
+    }
+    history_capacity = capacity;
+    history_labels.reserve(capacity);
+    history_features.reserve(capacity * stride);
 }
 
 void MLAugmentedDeadlockPrevention::train_risk_model() {
-    if(history.empty()) return;
+    std::lock_guard<std::mutex> training_lock(training_mutex);
     
-    std::vector<std::vector<double>> X;
-    std::vector<double> y;
+    // Copy the history into reusable buffers so examples can keep arriving while training
+    {
+        std::lock_guard<std::mutex> lock(history_mutex);
+        if(history_labels.empty()) return;
+        training_features.assign(history_features.begin(), history_features.end());
+        training_labels.assign(history_labels.begin(), history_labels.end());
+    }
     
-    for(const auto& example : history) {
-        X.push_back(example.features);
-        y.push_back(example.led_to_deadlock ? 1.0 : 0.0);
+    // Wait for stragglers still reading the standby slot from before the last flip
+    int active = active_model.load();
+    int standby = 1 - active;
+    while(model_readers[standby].load() != 0) {
+        std::this_thread::yield();
     }
     
-    risk_model.train(X, y);
+    // Train a copy of the current weights off to the side, then publish it
+    risk_models[standby] = risk_models[active];
+    risk_models[standby].train(training_features.data(), training_labels.data(), training_labels.size());
+    model_slot_version[standby] = model_version.load() + 1;
+    active_model.store(standby);
+    model_version++;
 }
 
 void MLAugmentedDeadlockPrevention::save_model(const std::string& filename) {
@@ -212,22 +958,28 @@ void MLAugmentedDeadlockPrevention::save_model(const std::string& filename) {
 }
 
 bool MLAugmentedDeadlockPrevention::is_safe_state(int process_id, const std::vector<int>& requested) {
-    std::vector<int> work = available;
-    std::vector<std::vector<int>> temp_allocated = allocated;
+    return is_safe_state(available, allocated, process_id, requested);
+}
+
+bool MLAugmentedDeadlockPrevention::is_safe_state(const std::vector<int>& available,
+                                                  const std::vector<std::vector<int>>& allocated,
+                                                  int process_id, const std::vector<int>& requested) const {
+    std::pmr::vector<int> work(available.begin(), available.end(), scratch_resource());
     
-    // Simulate allocation
+    // Simulate allocation; the requesting process's extra allocation is
+    // accounted for in can_complete instead of copying the whole matrix
     for(int i = 0; i < num_resources; i++) {
         if(requested[i] > work[i]) return false;
         work[i] -= requested[i];
-        temp_allocated[process_id][i] += requested[i];
     }
     
-    return can_complete(process_id, work, temp_allocated);
+    return can_complete(process_id, work, allocated, requested);
 }
 
-bool MLAugmentedDeadlockPrevention::can_complete(int process_id, std::vector<int>& work, 
-                                                const std::vector<std::vector<int>>& allocated) {
-    std::vector<bool> finished(num_processes, false);
+bool MLAugmentedDeadlockPrevention::can_complete(int process_id, std::pmr::vector<int>& work, 
+                                                const std::vector<std::vector<int>>& allocated,
+                                                const std::vector<int>& requested) const {
+    std::pmr::vector<bool> finished(num_processes, false, scratch_resource());
     int count = 0;
     
     while(count < num_processes) {
@@ -237,7 +989,8 @@ bool MLAugmentedDeadlockPrevention::can_complete(int process_id, std::vector<int
             if(!finished[i]) {
                 bool can_allocate = true;
                 for(int j = 0; j < num_resources; j++) {
-                    if(max_need[i][j] - allocated[i][j] > work[j]) {
+                    int held = allocated[i][j] + (i == process_id ? requested[j] : 0);
+                    if(max_need[i][j] - held > work[j]) {
                         can_allocate = false;
                         break;
                     }
@@ -245,7 +998,7 @@ bool MLAugmentedDeadlockPrevention::can_complete(int process_id, std::vector<int
                 
                 if(can_allocate) {
                     for(int j = 0; j < num_resources; j++) {
-                        work[j] += allocated[i][j];
+                        work[j] += allocated[i][j] + (i == process_id ? requested[j] : 0);
                     }
                     finished[i] = true;
                     count++;
@@ -266,4 +1019,179 @@ void MLAugmentedDeadlockPrevention::load_model(const std::string& filename) {
         // Implement model loading logic here
         file.close();
     }
-} 
\ No newline at end of file
+} 
+
+bool MLAugmentedDeadlockPrevention::open_journal(const std::string& path_prefix, size_t group_commit_size,
+                                                 size_t snapshot_interval,
+                                                 std::chrono::milliseconds max_commit_delay) {
+    auto new_journal = std::make_unique<AllocationJournal>(path_prefix, group_commit_size, snapshot_interval,
+                                                           max_commit_delay);
+
+    // Replay into the current state before attaching, so recovery is not re-journaled
+    bool found_state = false;
+    bool ok = new_journal->recover(
+        [this](const int32_t* data, size_t count) { return restore_state(data, count); },
+        [this](AllocationJournal::RecordType type, int process_id, const int32_t* payload, size_t count) {
+            apply_journal_record(type, process_id, payload, count);
+        },
+        found_state);
+    publish_rag_snapshot();
+    if(!ok) {
+        std::cerr << "Failed to recover allocation journal '" << path_prefix << "'\n";
+        return false;
+    }
+
+    if(found_state) {
+        std::cout << "Recovered allocation state from journal '" << path_prefix << "'\n";
+    } else if(!new_journal->write_snapshot(serialize_state())) {
+        // Fresh journal: capture the state configured so far as the base snapshot
+        return false;
+    }
+
+    journal = std::move(new_journal);
+    return true;
+}
+
+bool MLAugmentedDeadlockPrevention::sync_journal() {
+    return !journal || journal->commit();
+}
+
+void MLAugmentedDeadlockPrevention::journal_record(AllocationJournal::RecordType type, int process_id,
+                                                   const std::vector<int>& payload) {
+    journal_record(type, process_id, payload.data(), payload.size());
+}
+
+void MLAugmentedDeadlockPrevention::journal_record(AllocationJournal::RecordType type, int process_id,
+                                                   const int32_t* payload, size_t count) {
+    if(!journal) return;
+    if(!journal->append(type, process_id, payload, count) && !journal->has_failed()) {
+        std::cerr << "Allocation journal: failed to commit records\n";
+    }
+    if(journal->snapshot_due() && !journal->request_snapshot(serialize_state())) {
+        std::cerr << "Allocation journal: failed to write snapshot\n";
+    }
+}
+
+std::vector<int32_t> MLAugmentedDeadlockPrevention::serialize_state() const {
+    // Layout: resources, processes, available, allocated, max_need, blocked flags,
+    // outstanding requests, edge count, edges
+    std::vector<int32_t> state = {num_resources, num_processes};
+    state.insert(state.end(), available.begin(), available.end());
+    for(const auto& row : allocated) {
+        state.insert(state.end(), row.begin(), row.end());
+    }
+    for(int i = 0; i < num_processes; i++) {
+        for(int j = 0; j < num_resources; j++) {
+            state.push_back(i < static_cast<int>(max_need.size()) && j < static_cast<int>(max_need[i].size())
+                            ? max_need[i][j] : 0);
+        }
+    }
+    state.insert(state.end(), blocked.begin(), blocked.end());
+    for(const auto& row : outstanding) {
+        state.insert(state.end(), row.begin(), row.end());
+    }
+
+    // Edges come from the published graph snapshot, which concurrent update_rag
+    // calls replace rather than modify
+    auto graph = std::atomic_load(&rag_snapshot);
+    size_t edge_count_pos = state.size();
+    state.push_back(0);
+    for(size_t process_id = 0; process_id < graph->edges.size(); process_id++) {
+        for(int resource_id : graph->edges[process_id]) {
+            state.push_back(static_cast<int32_t>(process_id));
+            state.push_back(resource_id);
+            state[edge_count_pos]++;
+        }
+    }
+    return state;
+}
+
+bool MLAugmentedDeadlockPrevention::restore_state(const int32_t* data, size_t count) {
+    size_t matrix = static_cast<size_t>(num_processes) * num_resources;
+    size_t fixed = 2 + num_resources + 3 * matrix + num_processes + 1;
+    if(count < fixed || data[0] != num_resources || data[1] != num_processes) return false;
+
+    const int32_t* p = data + 2;
+    available.assign(p, p + num_resources);
+    p += num_resources;
+    for(auto& row : allocated) {
+        row.assign(p, p + num_resources);
+        p += num_resources;
+    }
+    max_need.assign(num_processes, std::vector<int>(num_resources, 0));
+    for(auto& row : max_need) {
+        row.assign(p, p + num_resources);
+        p += num_resources;
+    }
+    blocked.assign(p, p + num_processes);
+    p += num_processes;
+    for(auto& row : outstanding) {
+        row.assign(p, p + num_resources);
+        p += num_resources;
+    }
+
+    // Rebuild the derived detection state
+    blocked_count = 0;
+    std::fill(unblocked_held.begin(), unblocked_held.end(), 0);
+    for(int i = 0; i < num_processes; i++) {
+        blocked[i] = blocked[i] != 0;
+        blocked_count += blocked[i];
+        if(blocked[i]) continue;
+        for(int j = 0; j < num_resources; j++) {
+            unblocked_held[j] += allocated[i][j];
+        }
+    }
+
+    size_t edge_count = *p++;
+    if(count != fixed + 2 * edge_count) return false;
+    rag.clear();
+    for(size_t i = 0; i < edge_count; i++, p += 2) {
+        if(p[0] < 0 || p[1] < 0) return false;
+        rag[p[0]].insert(p[1]);
+    }
+    return true;
+}
+
+void MLAugmentedDeadlockPrevention::apply_journal_record(AllocationJournal::RecordType type, int process_id,
+                                                         const int32_t* payload, size_t count) {
+    std::vector<int> values(payload, payload + count);
+    bool per_process = type == AllocationJournal::RecordType::ALLOCATE ||
+                       type == AllocationJournal::RecordType::RELEASE ||
+                       type == AllocationJournal::RecordType::BLOCK_REQUEST ||
+                       type == AllocationJournal::RecordType::UNBLOCK_REQUEST;
+    if(per_process && (process_id < 0 || process_id >= num_processes ||
+                       count != static_cast<size_t>(num_resources))) {
+        return;
+    }
+
+    switch(type) {
+        case AllocationJournal::RecordType::SET_AVAILABLE:
+            set_available(values);
+            break;
+        case AllocationJournal::RecordType::SET_MAX_NEED: {
+            std::vector<std::vector<int>> need;
+            for(size_t i = 0; i + num_resources <= values.size(); i += num_resources) {
+                need.emplace_back(values.begin() + i, values.begin() + i + num_resources);
+            }
+            set_max_need(need);
+            break;
+        }
+        case AllocationJournal::RecordType::ALLOCATE:
+            allocate_resources(process_id, values);
+            break;
+        case AllocationJournal::RecordType::RELEASE:
+            release_resources(process_id, values);
+            break;
+        case AllocationJournal::RecordType::UPDATE_RAG:
+            // Edges go straight into the graph; open_journal publishes one snapshot
+            // after replay instead of copying it per record
+            if(!values.empty() && process_id >= 0 && values[0] >= 0) rag[process_id].insert(values[0]);
+            break;
+        case AllocationJournal::RecordType::BLOCK_REQUEST:
+            block_request(process_id, values);
+            break;
+        case AllocationJournal::RecordType::UNBLOCK_REQUEST:
+            unblock_request(process_id);
+            break;
+    }
+}
@@ -11,6 +11,17 @@
 #include <chrono>
 #include <fstream>
 #include <algorithm>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory_resource>
+
+// Per-thread pool for temporary buffers on the admission and training paths.
+// Blocks are recycled after warm-up, so steady-state calls do not hit the heap.
+std::pmr::memory_resource* scratch_resource();
 
 class SimpleNeuralNetwork {
 private:
@@ -19,10 +30,12 @@ private:
     std::vector<double> bias1;
     std::vector<double> bias2;
     
-    double sigmoid(double x) {
+    double sigmoid(double x) const {
         return 1.0 / (1.0 + exp(-x));
     }
 
+    void train_sample(const double* input, double target, double learning_rate, double* hidden);
+
 public:
     SimpleNeuralNetwork(int input_size, int hidden_size) {
         std::random_device rd;
@@ -48,8 +61,95 @@ public:
         bias2[0] = d(gen) * 0.1;
     }
 
-    double predict(const std::vector<double>& input);
+    double predict(const std::vector<double>& input) const;
+    double predict(const double* input, size_t count) const;
+    // Score `rows` row-major inputs of input_size() features each into `out`
+    void predict_batch(const double* inputs, size_t rows, double* out) const;
+    size_t input_size() const { return weights1.size(); }
     void train(const std::vector<std::vector<double>>& X, const std::vector<double>& y);
+    // Train on `rows` row-major inputs of input_size() features each
+    void train(const double* X, const double* y, size_t rows);
+};
+
+// Append-only binary log of allocation-state mutations with periodic snapshots.
+// Records are buffered and flushed together (group commit), at the latest
+// max_commit_delay after they were appended; snapshots are memory-mapped on
+// recovery so a restart only replays the journal tail.
+class AllocationJournal {
+public:
+    enum class RecordType : uint32_t {
+        SET_AVAILABLE = 1,
+        SET_MAX_NEED = 2,
+        ALLOCATE = 3,
+        RELEASE = 4,
+        UPDATE_RAG = 5,
+        BLOCK_REQUEST = 6,
+        UNBLOCK_REQUEST = 7
+    };
+
+    using SnapshotHandler = std::function<bool(const int32_t* data, size_t count)>;
+    using RecordHandler = std::function<void(RecordType type, int process_id,
+                                             const int32_t* payload, size_t count)>;
+
+    AllocationJournal(const std::string& path_prefix, size_t group_commit_size, size_t snapshot_interval,
+                      std::chrono::milliseconds max_commit_delay);
+    ~AllocationJournal();
+
+    AllocationJournal(const AllocationJournal&) = delete;
+    AllocationJournal& operator=(const AllocationJournal&) = delete;
+
+    // Load the latest snapshot and replay the journal tail written after it.
+    // Returns false if the files exist but could not be opened or applied.
+    bool recover(const SnapshotHandler& on_snapshot, const RecordHandler& on_record, bool& found_state);
+
+    // Buffer a record; returns false if a group commit it triggered failed.
+    bool append(RecordType type, int process_id, const int32_t* payload, size_t count);
+    // Write and sync buffered records. On failure the file is truncated back to
+    // the last committed record and the records stay buffered for a retry.
+    // If even that fails the journal is closed and every later call returns false.
+    bool commit();
+    bool has_failed() const;
+    bool snapshot_due() const;
+    // Write a snapshot of `state` now and start a new journal generation
+    bool write_snapshot(const std::vector<int32_t>& state);
+    // Hand `state` to the flush thread to be written in the background (written
+    // inline if there is none). Records appended afterwards go to the new generation.
+    bool request_snapshot(std::vector<int32_t>&& state);
+
+private:
+    std::string journal_path;
+    std::string snapshot_path;
+    size_t group_commit_size;
+    size_t snapshot_interval;
+    std::chrono::milliseconds max_commit_delay;
+    int fd = -1;
+    uint64_t generation = 0;
+    uint64_t committed_size = 0;
+    std::vector<char> pending;
+    size_t pending_records = 0;
+    size_t records_since_snapshot = 0;
+    bool failed = false;
+
+    // Snapshot waiting for the flush thread; the first snapshot_split bytes of
+    // pending were appended before it was captured
+    std::vector<int32_t> snapshot_state;
+    size_t snapshot_split = 0;
+    size_t snapshot_split_records = 0;
+    bool snapshot_queued = false;
+    bool snapshot_writing = false;
+
+    // Background flusher bounding how long an appended record stays buffered
+    mutable std::mutex mutex;
+    std::condition_variable flush_cv;
+    std::thread flush_thread;
+    bool stopping = false;
+
+    bool commit_locked();
+    bool commit_prefix_locked(size_t bytes, size_t records);
+    void queue_snapshot_locked(std::vector<int32_t>&& state);
+    bool write_queued_snapshot(std::unique_lock<std::mutex>& lock);
+    bool reset_journal();
+    void fail_locked();
 };
 
 class MLAugmentedDeadlockPrevention {
@@ -60,47 +160,160 @@ private:
     std::vector<std::vector<int>> allocated;
     std::vector<std::vector<int>> max_need;
     
-    SimpleNeuralNetwork risk_model;
+    // Outstanding requests of blocked processes, for multi-instance detection.
+    // unblocked_held is the sum of allocations of processes that are not
+    // blocked, maintained incrementally so detection starts from it directly.
+    std::vector<std::vector<int>> outstanding;
+    std::vector<char> blocked;
+    int blocked_count = 0;
+    std::vector<int> unblocked_held;
+    
+    // Double-buffered risk model: readers use the active slot without locking,
+    // training writes the standby slot and publishes it by flipping active_model
+    SimpleNeuralNetwork risk_models[2];
+    std::atomic<int> active_model{0};
+    mutable std::atomic<int> model_readers[2];
+    std::atomic<uint64_t> model_version{0};
+    uint64_t model_slot_version[2] = {0, 0};
+    std::mutex training_mutex;
     
     // Resource Allocation Graph
     std::unordered_map<int, std::set<int>> rag;
-    
-    // Training history
-    struct TrainingExample {
-        std::vector<double> features;
-        bool led_to_deadlock;
+
+    // Immutable copy of the RAG published on every update (read-copy-update),
+    // so detection never walks the map that update_rag is mutating
+    struct RagSnapshot {
+        std::vector<std::vector<int>> edges;
+        uint64_t version = 0;
     };
-    std::vector<TrainingExample> history;
+    std::shared_ptr<const RagSnapshot> rag_snapshot;
+    std::mutex rag_write_mutex;
+
+    // Background detection daemon
+    std::thread detection_thread;
+    std::mutex detection_mutex;
+    std::condition_variable detection_cv;
+    bool detection_running = false;
+    std::atomic<uint64_t> detection_passes{0};
+    std::atomic<uint64_t> detection_deadlocks{0};
+    std::atomic<uint64_t> detection_last_ns{0};
+    std::atomic<uint64_t> detection_max_ns{0};
+    std::atomic<uint64_t> detection_total_ns{0};
+    
+    // Training history: bounded ring of feature rows and labels, plus the
+    // buffers train_risk_model copies them into (reused between runs)
+    std::vector<double> history_features;
+    std::vector<double> history_labels;
+    size_t history_capacity = 100000;
+    size_t history_next = 0;
+    std::mutex history_mutex;
+    std::vector<double> training_features;
+    std::vector<double> training_labels;
+
+    // Crash-recovery journal (disabled unless open_journal is called)
+    std::unique_ptr<AllocationJournal> journal;
 
     bool is_safe_state(int process_id, const std::vector<int>& requested);
-    bool can_complete(int process_id, std::vector<int>& work, const std::vector<std::vector<int>>& allocated);
+    bool is_safe_state(const std::vector<int>& available, const std::vector<std::vector<int>>& allocated,
+                       int process_id, const std::vector<int>& requested) const;
+    bool can_complete(int process_id, std::pmr::vector<int>& work, const std::vector<std::vector<int>>& allocated,
+                      const std::vector<int>& requested) const;
+    void publish_rag_snapshot();
+    std::vector<std::vector<int>> find_cycles(const RagSnapshot& snapshot) const;
+    int acquire_model() const;
+    void release_model(int slot) const;
 
 public:
     MLAugmentedDeadlockPrevention(int num_res, int num_proc);
+    ~MLAugmentedDeadlockPrevention();
     
     // Getter methods
     const std::vector<int>& get_available() const { return available; }
     const std::vector<std::vector<int>>& get_allocated() const { return allocated; }
     const std::vector<std::vector<int>>& get_max_need() const { return max_need; }
+    const std::vector<std::vector<int>>& get_outstanding() const { return outstanding; }
+    bool is_blocked(int process_id) const { return blocked[process_id] != 0; }
     
     // Setter methods
-    void set_available(const std::vector<int>& resources) { available = resources; }
-    void set_max_need(const std::vector<std::vector<int>>& need) { max_need = need; }
+    void set_available(const std::vector<int>& resources);
+    void set_max_need(const std::vector<std::vector<int>>& need);
     
     // Resource management methods
     void allocate_resources(int process_id, const std::vector<int>& resources);
     void release_resources(int process_id, const std::vector<int>& resources);
     
+    // Record that a process is waiting for `resources` / is no longer waiting
+    void block_request(int process_id, const std::vector<int>& resources);
+    void unblock_request(int process_id);
+    // Multi-instance (Coffman) detection over allocated, available and the
+    // outstanding requests; returns the exact set of deadlocked processes
+    std::vector<int> detect_deadlocked_processes();
+    // Same, filling a caller-owned buffer so repeated calls need not allocate
+    void detect_deadlocked_processes(std::vector<int>& deadlocked);
+    
     double predict_deadlock_risk(int process_id, const std::vector<int>& requested_resources);
+    // Silent batched inference over precomputed feature rows (see feature_size)
+    void predict_risk_batch(const double* features, size_t rows, double* out) const;
+    // Pin the active model so several batches are scored by the same weights.
+    // Training cannot reuse a pinned slot, so unpin it promptly.
+    struct ModelHandle {
+        int slot;
+        uint64_t version;
+    };
+    ModelHandle pin_model() const;
+    void unpin_model(const ModelHandle& model) const;
+    void predict_risk_batch(const ModelHandle& model, const double* features, size_t rows, double* out) const;
+    size_t feature_size() const { return static_cast<size_t>(num_resources) * num_processes + num_resources; }
+    // Traditional Banker's safety check without the ML component
+    bool is_request_safe(int process_id, const std::vector<int>& requested_resources);
+    // Same check against a hypothetical allocation state (uses this system's max_need)
+    bool is_request_safe(int process_id, const std::vector<int>& requested_resources,
+                         const std::vector<int>& available_state,
+                         const std::vector<std::vector<int>>& allocated_state) const;
     bool ml_augmented_bankers_check(int process_id, const std::vector<int>& requested_resources);
     void update_rag(int process_id, int resource_id);
     std::vector<std::vector<int>> detect_cycles();
+
+    // Periodic detection on a background thread. Each pass runs on the latest
+    // published RAG snapshot, so writers never wait for it.
+    struct DetectionStats {
+        uint64_t passes;
+        uint64_t deadlocks_found;
+        double last_pass_us;
+        double max_pass_us;
+        double mean_pass_us;
+    };
+    using DeadlockCallback = std::function<void(const std::vector<std::vector<int>>& cycles)>;
+    void start_detection_daemon(std::chrono::milliseconds interval, DeadlockCallback on_deadlock);
+    void stop_detection_daemon();
+    DetectionStats get_detection_stats() const;
     bool ml_augmented_wait_die(int requesting_process, int holding_process, 
                               const std::unordered_map<int, double>& timestamp);
     void train_risk_model();
+    uint64_t get_model_version() const { return model_version.load(); }
     void add_training_example(const std::vector<double>& features, bool led_to_deadlock);
+    // Maximum number of examples kept; older examples are overwritten
+    void set_history_capacity(size_t capacity);
     void save_model(const std::string& filename);
     void load_model(const std::string& filename);
+
+    // Journal every state mutation to <path_prefix>.journal / <path_prefix>.snapshot.
+    // If a previous journal exists, the state is restored from it first.
+    // Records reach disk in groups of group_commit_size, or max_commit_delay after
+    // being appended, whichever comes first; call sync_journal to force it sooner.
+    // Write failures are reported on stderr and by sync_journal returning false.
+    bool open_journal(const std::string& path_prefix, size_t group_commit_size = 64,
+                      size_t snapshot_interval = 10000,
+                      std::chrono::milliseconds max_commit_delay = std::chrono::milliseconds(10));
+    bool sync_journal();
+
+private:
+    void journal_record(AllocationJournal::RecordType type, int process_id, const std::vector<int>& payload);
+    void journal_record(AllocationJournal::RecordType type, int process_id, const int32_t* payload, size_t count);
+    std::vector<int32_t> serialize_state() const;
+    bool restore_state(const int32_t* data, size_t count);
+    void apply_journal_record(AllocationJournal::RecordType type, int process_id,
+                              const int32_t* payload, size_t count);
 };
 
 // Add these before the DeadlockDetector class
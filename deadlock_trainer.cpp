@@ -4,6 +4,9 @@
 #include <random>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <numeric>
 
 volatile sig_atomic_t g_running = 1;
 
@@ -12,19 +15,60 @@ void signal_handler(int) {
     std::cout << "\nReceived stop signal. Finishing current batch and saving model...\n";
 }
 
+// Held-out metrics; the positive class is a request Banker's rejects as unsafe
+struct EvalReport {
+    size_t true_positives;
+    size_t false_positives;
+    size_t true_negatives;
+    size_t false_negatives;
+    double accuracy;
+    double precision;
+    double recall;
+    double auc;
+    double cases_per_second;
+    uint64_t model_version;
+};
+
 class DeadlockTrainer {
 private:
     MLAugmentedDeadlockPrevention& prevention;
     std::mt19937 rng;
     const unsigned long CHECKPOINT_INTERVAL = 10000; // Save every 10k scenarios
+    const size_t VALIDATION_CASES = 2000;
+    const unsigned EXPLORATION_ODDS = 4; // Grant 1 in 4 denied requests that fit
+    
+    // Fixed held-out set: row-major feature rows and one label per row (1 = unsafe)
+    std::vector<double> validation_features;
+    std::vector<unsigned char> validation_labels;
+    
+    // Persistent evaluation workers: each scores one slice of the held-out set and
+    // the last one to finish summarizes it, so starting an evaluation allocates nothing
+    std::vector<std::thread> eval_workers;
+    std::mutex eval_mutex;
+    std::condition_variable eval_cv;
+    uint64_t eval_generation = 0;
+    size_t eval_remaining = 0;
+    bool eval_busy = false;
+    bool eval_stopping = false;
+    bool report_ready = false;
+    EvalReport latest_report{};
+    MLAugmentedDeadlockPrevention::ModelHandle eval_model{};
+    std::chrono::steady_clock::time_point eval_start;
+    std::vector<double> eval_scores;
+    std::vector<size_t> eval_order;
     
-    // Generate random resource request
-    std::vector<int> generate_random_request(int max_resources) {
-        std::vector<int> request(prevention.get_available().size());
-        for(size_t i = 0; i < request.size(); i++) {
-            request[i] = rng() % (max_resources + 1);
+    // Buffers reused across scenarios so the training loop does not allocate
+    std::vector<int> request;
+    std::vector<int> release;
+    std::vector<double> features;
+    std::vector<int> deadlocked;
+    
+    // Generate random resource request into `out`
+    void generate_random_request(int max_resources, std::vector<int>& out) {
+        out.resize(prevention.get_available().size());
+        for(size_t i = 0; i < out.size(); i++) {
+            out[i] = rng() % (max_resources + 1);
         }
-        return request;
     }
 
     // Simulate deadlock scenario
@@ -36,12 +80,30 @@ private:
         for(int i = 0; i < num_processes; i++) {
             int process_id = rng() % num_processes;
             
-            // Generate random resource request
-            auto request = generate_random_request(5);
+            // A blocked process retries its outstanding request, others make a new one
+            // within their remaining claim (max_need - allocated)
+            if(prevention.is_blocked(process_id)) {
+                request = prevention.get_outstanding()[process_id];
+            } else {
+                generate_random_request(5, request);
+                const auto& held = prevention.get_allocated()[process_id];
+                const auto& claim = prevention.get_max_need()[process_id];
+                for(size_t r = 0; r < request.size(); r++) {
+                    request[r] = std::min(request[r], std::max(0, claim[r] - held[r]));
+                }
+            }
             
-            // Try allocation
+            // Try allocation; a denied request leaves the process waiting for it.
+            // Grants only pass the Banker's check, so the system would never leave a
+            // safe state; occasionally grant a denied request that fits anyway so
+            // the risk model sees states that do lead to deadlock.
             bool was_safe = prevention.ml_augmented_bankers_check(process_id, request);
-            if(was_safe) {
+            bool fits = true;
+            for(size_t r = 0; r < request.size(); r++) {
+                fits = fits && request[r] <= prevention.get_available()[r];
+            }
+            if(was_safe || (fits && rng() % EXPLORATION_ODDS == 0)) {
+                prevention.unblock_request(process_id);
                 prevention.allocate_resources(process_id, request);
                 
                 // Print allocation info
@@ -50,11 +112,18 @@ private:
                     std::cout << r << " ";
                 }
                 std::cout << "\n";
+            } else {
+                prevention.block_request(process_id, request);
             }
             
-            // Randomly release some resources
-            if(rng() % 2 == 0) {
-                auto release = generate_random_request(3);
+            // Randomly release some resources (never more than the process holds);
+            // a process waiting on a request cannot run, so it cannot release
+            if(!prevention.is_blocked(process_id) && rng() % 2 == 0) {
+                generate_random_request(3, release);
+                const auto& held = prevention.get_allocated()[process_id];
+                for(size_t r = 0; r < release.size(); r++) {
+                    release[r] = std::min(release[r], held[r]);
+                }
                 prevention.release_resources(process_id, release);
                 
                 std::cout << "Process " << process_id << " released resources: ";
@@ -63,20 +132,24 @@ private:
                 }
                 std::cout << "\n";
             }
-        }
-        
-        // Check for deadlock using RAG
-        auto cycles = prevention.detect_cycles();
-        deadlock_detected = !cycles.empty();
-        
-        if(deadlock_detected) {
-            std::cout << "Deadlock detected between processes: ";
-            for(const auto& cycle : cycles) {
-                for(int node : cycle) {
+            
+            // Multi-instance detection over the allocation and request matrices
+            prevention.detect_deadlocked_processes(deadlocked);
+            if(!deadlocked.empty()) {
+                deadlock_detected = true;
+                std::cout << "Deadlock detected between processes: ";
+                for(int node : deadlocked) {
                     std::cout << node << " ";
                 }
+                std::cout << "\n";
+                
+                // Recover by aborting one deadlocked process and reclaiming what it holds
+                int victim = deadlocked[rng() % deadlocked.size()];
+                release = prevention.get_allocated()[victim];
+                prevention.unblock_request(victim);
+                prevention.release_resources(victim, release);
+                std::cout << "Aborted process " << victim << " to break the deadlock\n";
             }
-            std::cout << "\n";
         }
         
         return deadlock_detected;
@@ -91,7 +164,30 @@ private:
 
 public:
     DeadlockTrainer(MLAugmentedDeadlockPrevention& prev) 
-        : prevention(prev), rng(std::random_device{}()) {}
+        : prevention(prev), rng(std::random_device{}()) {
+        deadlocked.reserve(prevention.get_allocated().size());
+        features.reserve(prevention.feature_size());
+    }
+    
+    ~DeadlockTrainer() {
+        stop_evaluation_workers();
+    }
+    
+    // One training step: record the current state, simulate a scenario from it
+    // and store the outcome as a training example
+    bool run_scenario() {
+        features.clear();
+        for(const auto& alloc : prevention.get_allocated()) {
+            features.insert(features.end(), alloc.begin(), alloc.end());
+        }
+        features.insert(features.end(), 
+                      prevention.get_available().begin(), 
+                      prevention.get_available().end());
+        
+        bool led_to_deadlock = simulate_scenario();
+        prevention.add_training_example(features, led_to_deadlock);
+        return led_to_deadlock;
+    }
 
     void train_continuously() {
         std::cout << "Starting continuous training. Press Ctrl+C to stop and save model.\n"
@@ -100,19 +196,11 @@ public:
         
         unsigned long scenarios_count = 0;
         auto start_time = std::chrono::steady_clock::now();
+        generate_validation_set();
         
         while(g_running) {
             // Generate training scenario
-            std::vector<double> features;
-            for(const auto& alloc : prevention.get_allocated()) {
-                features.insert(features.end(), alloc.begin(), alloc.end());
-            }
-            features.insert(features.end(), 
-                          prevention.get_available().begin(), 
-                          prevention.get_available().end());
-            
-            bool led_to_deadlock = simulate_scenario();
-            prevention.add_training_example(features, led_to_deadlock);
+            run_scenario();
             
             // Add checkpoint saving
             if(scenarios_count % CHECKPOINT_INTERVAL == 0) {
@@ -145,10 +233,10 @@ public:
                               (current_time - start_time);
                 
                 std::cout << "Trained on " << scenarios_count << " scenarios. "
-                         << "Running time: " << duration.count() << " minutes\n"
-                         << "Current deadlock detection accuracy: " 
-                         << calculate_accuracy() << "%\n";
+                         << "Running time: " << duration.count() << " minutes\n";
+                poll_evaluation();
             }
+            scenarios_count++;
         }
         
         // Final training and save
@@ -163,44 +251,229 @@ public:
                   << "Total scenarios: " << scenarios_count << "\n"
                   << "Total time: " << total_duration.count() << " minutes\n"
                   << "Model saved to 'final_model.dat'\n";
+        print_report(evaluate());
     }
 
-    double calculate_accuracy() {
-        int correct_predictions = 0;
-        const int TEST_CASES = 100;
-        
-        // Get number of processes from the prevention object
+    // Build a class-balanced held-out set from random states reachable from the
+    // current one. Rows use the admission-path layout (the allocation state before
+    // the request, as fed to predict_deadlock_risk); the label is the traditional
+    // Banker's verdict on a request drawn within the process's remaining need.
+    // The request itself is not part of the row, and the label is not the
+    // led_to_deadlock outcome the model trains on: the report measures how well
+    // the risk score agrees with Banker's on these states, not deadlock accuracy.
+    // Samples of a class that has reached its quota are rejected. Calling it again
+    // replaces the set, restarting the evaluation workers around the swap.
+    void generate_validation_set() {
+        stop_evaluation_workers();
         int num_processes = prevention.get_allocated().size();
+        int num_resources = prevention.get_available().size();
+        const auto& max_need = prevention.get_max_need();
+        validation_features.clear();
+        validation_features.reserve(VALIDATION_CASES * prevention.feature_size());
+        validation_labels.clear();
+        validation_labels.reserve(VALIDATION_CASES);
+        
+        // Total instances of each resource, allocated or not
+        std::vector<int> total = prevention.get_available();
+        for(const auto& alloc : prevention.get_allocated()) {
+            for(int r = 0; r < num_resources; r++) total[r] += alloc[r];
+        }
+        
+        std::vector<std::vector<int>> sample_allocated(num_processes, std::vector<int>(num_resources, 0));
+        std::vector<int> sample_available(num_resources);
+        std::vector<int> sample_request(num_resources);
+        size_t quota[2] = {VALIDATION_CASES / 2, VALIDATION_CASES - VALIDATION_CASES / 2};
+        size_t filled[2] = {0, 0};
         
-        for(int i = 0; i < TEST_CASES; i++) {
-            // Generate a realistic test case
-            int process_id = rng() % num_processes;  // Using rng instead of rand()
-            auto test_request = generate_random_request(5);
+        // Give up on a class that cannot reach its quota from this configuration
+        const size_t MAX_ATTEMPTS = VALIDATION_CASES * 1000;
+        for(size_t attempt = 0; attempt < MAX_ATTEMPTS && filled[0] + filled[1] < VALIDATION_CASES; attempt++) {
+            // Random allocation within each process's maximum claim
+            sample_available = total;
+            for(int p = 0; p < num_processes; p++) {
+                for(int r = 0; r < num_resources; r++) {
+                    int limit = std::min(max_need[p][r], sample_available[r]);
+                    sample_allocated[p][r] = limit > 0 ? rng() % (limit + 1) : 0;
+                    sample_available[r] -= sample_allocated[p][r];
+                }
+            }
             
-            // Use ml_augmented_bankers_check instead of private is_safe_state
-            bool bankers_safe = prevention.ml_augmented_bankers_check(process_id, test_request);
+            int process_id = rng() % num_processes;
+            for(int r = 0; r < num_resources; r++) {
+                int remaining = std::max(0, max_need[process_id][r] - sample_allocated[process_id][r]);
+                sample_request[r] = rng() % (remaining + 1);
+            }
+            int label = prevention.is_request_safe(process_id, sample_request,
+                                                   sample_available, sample_allocated) ? 0 : 1;
+            if(filled[label] >= quota[label]) continue;
+            filled[label]++;
             
-            // Get ML prediction
-            double predicted_risk = prevention.predict_deadlock_risk(process_id, test_request);
+            for(const auto& alloc : sample_allocated) {
+                validation_features.insert(validation_features.end(), alloc.begin(), alloc.end());
+            }
+            validation_features.insert(validation_features.end(), sample_available.begin(), sample_available.end());
+            validation_labels.push_back(label);
+        }
+        
+        start_evaluation_workers();
+    }
+    
+    // Score the held-out set on the evaluation workers and wait for the report
+    EvalReport evaluate() {
+        std::unique_lock<std::mutex> lock(eval_mutex);
+        if(eval_workers.empty()) return EvalReport{};
+        eval_cv.wait(lock, [this]() { return !eval_busy; });
+        start_evaluation_locked();
+        eval_cv.wait(lock, [this]() { return !eval_busy; });
+        report_ready = false;
+        return latest_report;
+    }
+    
+    static void print_report(const EvalReport& report) {
+        std::cout << "Held-out agreement with Banker's (model v" << report.model_version << "): "
+                  << "accuracy " << report.accuracy << "%, "
+                  << "precision " << report.precision << ", "
+                  << "recall " << report.recall << ", "
+                  << "AUC " << report.auc << ", "
+                  << report.cases_per_second << " cases/s\n"
+                  << "Class balance: " << report.true_positives + report.false_negatives << " unsafe / "
+                  << report.true_negatives + report.false_positives << " safe\n"
+                  << "Confusion matrix [TP FP; FN TN]: ["
+                  << report.true_positives << " " << report.false_positives << "; "
+                  << report.false_negatives << " " << report.true_negatives << "]\n";
+    }
+    
+    // Metrics for `scores` against `labels` (1 = unsafe) scored in `seconds`;
+    // `order` is scratch space of the same length, so summarizing does not allocate
+    static EvalReport summarize(const std::vector<double>& scores, const std::vector<unsigned char>& labels,
+                                std::vector<size_t>& order, double seconds) {
+        EvalReport report{};
+        size_t cases = labels.size();
+        report.cases_per_second = seconds > 0 ? cases / seconds : 0.0;
+        
+        // Confusion matrix at the admission threshold (unsafe is the positive class)
+        for(size_t i = 0; i < cases; i++) {
+            bool predicted_unsafe = scores[i] >= 0.5;
+            bool unsafe = labels[i] != 0;
+            if(predicted_unsafe && unsafe) report.true_positives++;
+            else if(predicted_unsafe) report.false_positives++;
+            else if(unsafe) report.false_negatives++;
+            else report.true_negatives++;
+        }
+        size_t predicted_positives = report.true_positives + report.false_positives;
+        size_t positives = report.true_positives + report.false_negatives;
+        size_t negatives = cases - positives;
+        report.accuracy = 100.0 * (report.true_positives + report.true_negatives) / cases;
+        report.precision = predicted_positives > 0 ? static_cast<double>(report.true_positives) / predicted_positives : 0.0;
+        report.recall = positives > 0 ? static_cast<double>(report.true_positives) / positives : 0.0;
+        
+        // ROC AUC from the rank sum of positive scores (Mann-Whitney U), ties get average rank
+        report.auc = 0.5;
+        if(positives > 0 && negatives > 0) {
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&scores](size_t a, size_t b) { return scores[a] < scores[b]; });
+            double positive_rank_sum = 0.0;
+            for(size_t i = 0; i < cases;) {
+                size_t j = i;
+                while(j < cases && scores[order[j]] == scores[order[i]]) j++;
+                double average_rank = (i + j + 1) / 2.0;
+                for(size_t k = i; k < j; k++) {
+                    if(labels[order[k]]) positive_rank_sum += average_rank;
+                }
+                i = j;
+            }
+            report.auc = (positive_rank_sum - positives * (positives + 1) / 2.0) / (static_cast<double>(positives) * negatives);
+        }
+        
+        return report;
+    }
+    
+    // Print a finished evaluation, if any, and start the next one in the background
+    void poll_evaluation() {
+        EvalReport report;
+        bool have_report = false;
+        {
+            std::lock_guard<std::mutex> lock(eval_mutex);
+            if(eval_workers.empty()) return;
+            if(report_ready) {
+                report = latest_report;
+                report_ready = false;
+                have_report = true;
+            }
+            if(!eval_busy) start_evaluation_locked();
+        }
+        if(have_report) print_report(report);
+    }
+
+private:
+    void start_evaluation_workers() {
+        if(!eval_workers.empty() || validation_labels.empty()) return;
+        size_t cases = validation_labels.size();
+        eval_scores.assign(cases, 0.0);
+        eval_order.assign(cases, 0);
+        
+        size_t workers = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), cases / 256));
+        for(size_t i = 0; i < workers; i++) {
+            eval_workers.emplace_back([this, i, workers]() { evaluation_worker(i, workers); });
+        }
+    }
+    
+    // Workers hold slice bounds into the held-out set, so they must be stopped
+    // before it changes
+    void stop_evaluation_workers() {
+        {
+            // Let a running evaluation finish so its pinned model is released
+            std::unique_lock<std::mutex> lock(eval_mutex);
+            eval_cv.wait(lock, [this]() { return !eval_busy; });
+            eval_stopping = true;
+        }
+        eval_cv.notify_all();
+        for(auto& worker : eval_workers) worker.join();
+        eval_workers.clear();
+        eval_stopping = false;
+        report_ready = false;
+    }
+    
+    void start_evaluation_locked() {
+        eval_busy = true;
+        eval_generation++;
+        eval_remaining = eval_workers.size();
+        // Every worker scores with the same pinned model; the last one unpins it
+        eval_model = prevention.pin_model();
+        eval_start = std::chrono::steady_clock::now();
+        eval_cv.notify_all();
+    }
+    
+    void evaluation_worker(size_t index, size_t workers) {
+        size_t cases = validation_labels.size();
+        size_t stride = prevention.feature_size();
+        size_t chunk = (cases + workers - 1) / workers;
+        size_t begin = std::min(cases, index * chunk);
+        size_t count = std::min(chunk, cases - begin);
+        uint64_t seen = 0;
+        
+        std::unique_lock<std::mutex> lock(eval_mutex);
+        while(true) {
+            eval_cv.wait(lock, [this, seen]() { return eval_stopping || eval_generation != seen; });
+            if(eval_stopping) return;
+            seen = eval_generation;
+            auto model = eval_model;
             
-            // Compare ML prediction with Banker's algorithm
-            bool ml_safe = predicted_risk < 0.5;
-            if(ml_safe == bankers_safe) {
-                correct_predictions++;
+            lock.unlock();
+            if(count > 0) {
+                prevention.predict_risk_batch(model, &validation_features[begin * stride], count, &eval_scores[begin]);
             }
+            lock.lock();
             
-            // Log disagreements for analysis
-            if(ml_safe != bankers_safe) {
-                std::cout << "ML disagreed with Banker's Algorithm:\n"
-                         << "Process: " << process_id << "\n"
-                         << "Request: ";
-                for(int r : test_request) std::cout << r << " ";
-                std::cout << "\nML risk: " << predicted_risk 
-                         << "\nBanker's: " << (bankers_safe ? "safe" : "unsafe")
-                         << "\n\n";
+            if(--eval_remaining == 0) {
+                prevention.unpin_model(eval_model);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - eval_start).count();
+                latest_report = summarize(eval_scores, validation_labels, eval_order, seconds);
+                latest_report.model_version = eval_model.version;
+                report_ready = true;
+                eval_busy = false;
+                eval_cv.notify_all();
             }
         }
-        
-        return (correct_predictions * 100.0) / TEST_CASES;
     }
-}; 
\ No newline at end of file
+};
\ No newline at end of file
@@ -1,8 +1,27 @@
 #include "deadlock_prevention.hpp"
+#include "deadlock_trainer.cpp"
 #include <iostream>
 #include <iomanip>
 #include <thread>
 #include <chrono>
+#include <cstdlib>
+#include <new>
+#include <fstream>
+#include <iterator>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Count heap allocations so Test 6 can check the steady state makes none
+static std::atomic<size_t> g_allocations{0};
+
+void* operator new(std::size_t size) {
+    g_allocations++;
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
 
 void print_state(const MLAugmentedDeadlockPrevention& prevention) {
     std::cout << "\nCurrent System State:\n";
@@ -22,6 +41,30 @@ void print_state(const MLAugmentedDeadlockPrevention& prevention) {
     std::cout << "\n";
 }
 
+bool same_state(const MLAugmentedDeadlockPrevention& a, const MLAugmentedDeadlockPrevention& b) {
+    return a.get_available() == b.get_available() &&
+           a.get_allocated() == b.get_allocated() &&
+           a.get_max_need() == b.get_max_need() &&
+           a.get_outstanding() == b.get_outstanding();
+}
+
+// Mutations used by the journal recovery test, applied `count` at a time
+void apply_journal_ops(MLAugmentedDeadlockPrevention& prevention, int first, int count) {
+    for(int i = first; i < first + count; i++) {
+        switch(i % 4) {
+            case 0: prevention.allocate_resources(i % 5, {1, 1, 0}); break;
+            case 1: prevention.release_resources((i - 1) % 5, {0, 1, 0}); break;
+            case 2: prevention.block_request(i % 5, {2, 0, 1}); break;
+            case 3: prevention.update_rag(i % 5, (i + 1) % 5); break;
+        }
+    }
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
 int main() {
     std::cout << "Initializing deadlock prevention system...\n";
     // Initialize the system with 3 resources and 5 processes
@@ -112,5 +155,319 @@ int main() {
     
     prevention.save_model("learned_policy.dat");
     
+    // Test 5: Background detection daemon
+    std::cout << "\n=== Test 5: Background Deadlock Detection ===\n";
+    MLAugmentedDeadlockPrevention monitored(3, 5);
+    std::atomic<int> deadlock_events{0};
+    monitored.start_detection_daemon(std::chrono::milliseconds(5),
+        [&deadlock_events](const std::vector<std::vector<int>>& found) {
+            deadlock_events++;
+            std::cout << "Daemon found " << found.size() << " cycle(s)\n";
+        });
+    
+    std::cout << "Adding edges to RAG while daemon runs: 3->4, 4->3\n";
+    monitored.update_rag(3, 4);
+    monitored.update_rag(4, 3);
+    
+    // Wait for the daemon to pick up the cycle, giving up after two seconds
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(deadlock_events.load() == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    monitored.stop_detection_daemon();
+    
+    auto stats = monitored.get_detection_stats();
+    std::cout << "Detection passes: " << stats.passes
+              << ", deadlock events: " << stats.deadlocks_found
+              << ", mean pass latency: " << stats.mean_pass_us << " us"
+              << ", max: " << stats.max_pass_us << " us\n";
+    if(deadlock_events.load() == 0 || stats.passes == 0 || stats.deadlocks_found == 0) {
+        std::cout << "FAILED: daemon did not report the cycle\n";
+        return 1;
+    }
+    std::cout << "PASSED\n";
+    
+    // Test 6: Allocation-free steady state
+    // Scoped so the trainer's evaluation workers are joined before Test 8 forks
+    {
+        std::cout << "\n=== Test 6: Steady-State Heap Allocations ===\n";
+        MLAugmentedDeadlockPrevention steady(3, 5);
+        steady.set_available(initial_resources);
+        steady.set_max_need(max_needs);
+        steady.set_history_capacity(16);
+        std::vector<int> request = {1, 0, 1};
+        std::vector<double> features(steady.feature_size(), 1.0);
+        std::vector<int> deadlocked;
+        deadlocked.reserve(5);
+        long admissions_run = 0;
+    
+        // Admission path: every call runs regardless of the model's verdict
+        auto run_admission_round = [&]() {
+            for(int p = 0; p < 5; p++) {
+                steady.ml_augmented_bankers_check(p, request);
+                int held = steady.get_allocated()[p][0];
+                steady.allocate_resources(p, request);
+                bool allocated = steady.get_allocated()[p][0] == held + request[0];
+                steady.block_request(p, request);
+                steady.detect_deadlocked_processes(deadlocked);
+                steady.unblock_request(p);
+                steady.release_resources(p, request);
+                if(allocated && steady.get_allocated()[p][0] == held) admissions_run++;
+                steady.add_training_example(features, p % 2 == 0);
+            }
+            steady.detect_cycles();
+            steady.train_risk_model();
+        };
+    
+        // Trainer loop: scenarios, periodic training and background evaluation
+        MLAugmentedDeadlockPrevention trained(3, 5);
+        trained.set_available(initial_resources);
+        trained.set_max_need(max_needs);
+        trained.set_history_capacity(16);
+        DeadlockTrainer steady_trainer(trained);
+        steady_trainer.generate_validation_set();
+        long scenarios_run = 0;
+        auto run_trainer_round = [&]() {
+            for(int i = 0; i < 5; i++) {
+                steady_trainer.run_scenario();
+                scenarios_run++;
+            }
+            trained.train_risk_model();
+            steady_trainer.poll_evaluation();
+        };
+    
+        // Warm up until the history rings and scratch pools reach their steady size
+        for(int i = 0; i < 10; i++) {
+            run_admission_round();
+            run_trainer_round();
+        }
+        steady_trainer.evaluate();
+    
+        admissions_run = 0;
+        scenarios_run = 0;
+        size_t before = g_allocations.load();
+        for(int i = 0; i < 10; i++) {
+            run_admission_round();
+            run_trainer_round();
+        }
+        EvalReport steady_report = steady_trainer.evaluate();
+        size_t steady_allocations = g_allocations.load() - before;
+        size_t evaluated = steady_report.true_positives + steady_report.false_positives +
+                           steady_report.true_negatives + steady_report.false_negatives;
+    
+        std::cout << "Admissions run: " << admissions_run << ", trainer scenarios run: " << scenarios_run
+                  << ", held-out cases evaluated: " << evaluated << "\n";
+        std::cout << "Heap allocations in steady state: " << steady_allocations << "\n";
+        if(admissions_run != 50 || scenarios_run != 50 || evaluated == 0) {
+            std::cout << "FAILED: steady-state loops did not run\n";
+            return 1;
+        }
+        if(steady_allocations != 0) {
+            std::cout << "FAILED: admission and training loops should not allocate\n";
+            return 1;
+        }
+        
+        // Regenerating the held-out set while an evaluation runs restarts the workers on the new set
+        steady_trainer.poll_evaluation();
+        steady_trainer.generate_validation_set();
+        EvalReport regenerated_report = steady_trainer.evaluate();
+        size_t regenerated = regenerated_report.true_positives + regenerated_report.false_positives +
+                             regenerated_report.true_negatives + regenerated_report.false_negatives;
+        if(regenerated != evaluated) {
+            std::cout << "FAILED: evaluation after regenerating the held-out set covered "
+                      << regenerated << " cases\n";
+            return 1;
+        }
+        std::cout << "PASSED\n";
+    }
+    
+    // Test 7: Multi-instance deadlock detection
+    std::cout << "\n=== Test 7: Multi-instance Deadlock Detection ===\n";
+    MLAugmentedDeadlockPrevention multi(2, 3);
+    multi.set_available({2, 2});
+    multi.allocate_resources(0, {2, 0});
+    multi.allocate_resources(1, {0, 2});
+    std::cout << "Process 0 holds 2x R0 and waits for 1x R1, process 1 holds 2x R1 and waits for 1x R0\n";
+    multi.block_request(0, {0, 1});
+    multi.block_request(1, {1, 0});
+    
+    auto print_deadlocked = [](const std::vector<int>& deadlocked) {
+        if(deadlocked.empty()) {
+            std::cout << "No deadlock\n";
+            return;
+        }
+        std::cout << "Deadlocked processes: ";
+        for(int p : deadlocked) std::cout << p << " ";
+        std::cout << "\n";
+    };
+    auto deadlocked_before = multi.detect_deadlocked_processes();
+    print_deadlocked(deadlocked_before);
+    
+    std::cout << "Process 1 releases 1x R1\n";
+    multi.release_resources(1, {0, 1});
+    auto deadlocked_after = multi.detect_deadlocked_processes();
+    print_deadlocked(deadlocked_after);
+    if(deadlocked_before != std::vector<int>{0, 1} || !deadlocked_after.empty()) {
+        std::cout << "FAILED: expected processes 0 and 1 deadlocked until the release\n";
+        return 1;
+    }
+    std::cout << "PASSED\n";
+    
+    // Test 8: Crash recovery from the allocation journal
+    std::cout << "\n=== Test 8: Allocation Journal Recovery ===\n";
+    const std::string journal_prefix = "deadlock_test_journal";
+    auto remove_journal = [&journal_prefix]() {
+        std::remove((journal_prefix + ".journal").c_str());
+        std::remove((journal_prefix + ".snapshot").c_str());
+    };
+    auto fresh_state = [&]() {
+        auto prevention = std::make_unique<MLAugmentedDeadlockPrevention>(3, 5);
+        prevention->set_available(initial_resources);
+        prevention->set_max_need(max_needs);
+        return prevention;
+    };
+    remove_journal();
+    
+    // The child journals 10 operations (crossing two snapshots), syncs, then makes one
+    // more change and exits without destructors after the commit delay has passed
+    std::cout.flush();
+    pid_t child = fork();
+    if(child == 0) {
+        auto* crashing = fresh_state().release();
+        if(!crashing->open_journal(journal_prefix, 64, 4, std::chrono::milliseconds(5))) _exit(2);
+        apply_journal_ops(*crashing, 0, 10);
+        if(!crashing->sync_journal()) _exit(3);
+        apply_journal_ops(*crashing, 10, 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        _exit(0);
+    }
+    int child_status = 0;
+    waitpid(child, &child_status, 0);
+    
+    auto expected = fresh_state();
+    apply_journal_ops(*expected, 0, 11);
+    auto recovered = fresh_state();
+    bool recovered_ok = WIFEXITED(child_status) && WEXITSTATUS(child_status) == 0 &&
+                        recovered->open_journal(journal_prefix) && same_state(*recovered, *expected);
+    std::cout << "Snapshot load and tail replay after crash: " << (recovered_ok ? "ok" : "mismatch") << "\n";
+    
+    // A torn record at the tail is dropped and new records are appended after the valid ones
+    recovered.reset();
+    {
+        std::ofstream journal_file(journal_prefix + ".journal", std::ios::binary | std::ios::app);
+        journal_file.write("\x03\x00\x00\x00\x01", 5);
+    }
+    recovered = fresh_state();
+    bool torn_ok = recovered->open_journal(journal_prefix) && same_state(*recovered, *expected);
+    apply_journal_ops(*recovered, 11, 2);
+    apply_journal_ops(*expected, 11, 2);
+    recovered.reset();
+    recovered = fresh_state();
+    torn_ok = torn_ok && recovered->open_journal(journal_prefix) && same_state(*recovered, *expected);
+    std::cout << "Torn tail truncated and appends preserved: " << (torn_ok ? "ok" : "mismatch") << "\n";
+    
+    // A journal left over from before the latest snapshot must not be replayed again
+    recovered.reset();
+    remove_journal();
+    recovered = fresh_state();
+    bool stale_ok = recovered->open_journal(journal_prefix, 64, 3);
+    apply_journal_ops(*recovered, 0, 2);
+    stale_ok = stale_ok && recovered->sync_journal();
+    std::string stale_journal = read_file(journal_prefix + ".journal");
+    apply_journal_ops(*recovered, 2, 1);
+    recovered.reset();
+    {
+        std::ofstream journal_file(journal_prefix + ".journal", std::ios::binary | std::ios::trunc);
+        journal_file.write(stale_journal.data(), stale_journal.size());
+    }
+    expected = fresh_state();
+    apply_journal_ops(*expected, 0, 3);
+    recovered = fresh_state();
+    stale_ok = stale_ok && recovered->open_journal(journal_prefix) && same_state(*recovered, *expected);
+    std::cout << "Journal from an older generation ignored: " << (stale_ok ? "ok" : "mismatch") << "\n";
+    recovered.reset();
+    remove_journal();
+    
+    if(!recovered_ok || !torn_ok || !stale_ok) {
+        std::cout << "FAILED: journal recovery did not restore the journaled state\n";
+        return 1;
+    }
+    std::cout << "PASSED\n";
+    
+    // Test 9: Concurrent training and inference
+    std::cout << "\n=== Test 9: Concurrent Training and Inference ===\n";
+    auto serving = fresh_state();
+    for(int i = 0; i < 32; i++) {
+        std::vector<double> example(serving->feature_size(), i % 4);
+        serving->add_training_example(example, i % 2 == 0);
+    }
+    
+    // A reader scores a fixed batch while a trainer publishes new weights
+    uint64_t start_version = serving->get_model_version();
+    std::vector<double> batch(8 * serving->feature_size());
+    for(size_t i = 0; i < batch.size(); i++) batch[i] = i % 7;
+    std::atomic<bool> training_done{false};
+    std::atomic<bool> scores_finite{true};
+    std::atomic<long> batches_scored{0};
+    std::thread reader([&]() {
+        std::vector<double> scores(8);
+        while(!training_done.load() || batches_scored.load() == 0) {
+            serving->predict_risk_batch(batch.data(), 8, scores.data());
+            for(double score : scores) {
+                if(!std::isfinite(score) || score < 0.0 || score > 1.0) scores_finite = false;
+            }
+            batches_scored++;
+        }
+    });
+    std::thread trainer([&]() {
+        for(int i = 0; i < 50; i++) serving->train_risk_model();
+        training_done = true;
+    });
+    trainer.join();
+    reader.join();
+    
+    uint64_t end_version = serving->get_model_version();
+    std::cout << "Model version " << start_version << " -> " << end_version
+              << ", batches scored during training: " << batches_scored.load() << "\n";
+    if(end_version != start_version + 50 || !scores_finite.load()) {
+        std::cout << "FAILED: versions should advance once per training run and scores stay in [0, 1]\n";
+        return 1;
+    }
+    
+    // A pinned model keeps its weights and version while a newer one is published
+    auto pinned = serving->pin_model();
+    std::vector<double> pinned_before(8), pinned_after(8);
+    serving->predict_risk_batch(pinned, batch.data(), 8, pinned_before.data());
+    serving->train_risk_model();
+    serving->predict_risk_batch(pinned, batch.data(), 8, pinned_after.data());
+    serving->unpin_model(pinned);
+    std::cout << "Pinned model v" << pinned.version << " while v" << serving->get_model_version() << " was published\n";
+    if(pinned.version != end_version || pinned_before != pinned_after ||
+       serving->get_model_version() != end_version + 1) {
+        std::cout << "FAILED: a pinned model should score identically across a training run\n";
+        return 1;
+    }
+    std::cout << "PASSED\n";
+    
+    // Test 10: Held-out metrics on fixed scores
+    std::cout << "\n=== Test 10: Held-out Evaluation Metrics ===\n";
+    // Three unsafe rows above the 0.5 threshold and one below; two safe rows above.
+    // The 0.6 tie between one unsafe and two safe rows counts as half a win each.
+    std::vector<double> fixed_scores = {0.9, 0.8, 0.6, 0.6, 0.4, 0.3, 0.6, 0.2};
+    std::vector<unsigned char> fixed_labels = {1, 1, 1, 0, 1, 0, 0, 0};
+    std::vector<size_t> fixed_order(fixed_scores.size());
+    EvalReport fixed_report = DeadlockTrainer::summarize(fixed_scores, fixed_labels, fixed_order, 2.0);
+    DeadlockTrainer::print_report(fixed_report);
+    auto near = [](double a, double b) { return std::abs(a - b) < 1e-12; };
+    if(fixed_report.true_positives != 3 || fixed_report.false_positives != 2 ||
+       fixed_report.false_negatives != 1 || fixed_report.true_negatives != 2 ||
+       !near(fixed_report.accuracy, 62.5) || !near(fixed_report.precision, 0.6) ||
+       !near(fixed_report.recall, 0.75) || !near(fixed_report.auc, 13.0 / 16.0) ||
+       !near(fixed_report.cases_per_second, 4.0)) {
+        std::cout << "FAILED: expected [3 2; 1 2], precision 0.6, recall 0.75, AUC 0.8125\n";
+        return 1;
+    }
+    std::cout << "PASSED\n";
+    
     return 0;
 } 
\ No newline at end of file